@@ -3,10 +3,18 @@
 #include <cstdint>
 #include <stdexcept>
 #include <sstream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
 #include <winsock2.h>
+#include <afunix.h>
 #include <windows.h>
 #include <thread>
 #include <map>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
 
 #pragma comment(lib, "ws2_32.lib")
 #pragma warning(disable: 4996)
@@ -24,7 +32,9 @@ enum CommandOpcode {
     GET_WIDTH_OPCODE,       
     GET_HEIGHT_OPCODE,
     LOAD_SPRITE_OPCODE,    
-    SHOW_SPRITE_OPCODE
+    SHOW_SPRITE_OPCODE,
+    BEGIN_FRAME_OPCODE,
+    END_FRAME_OPCODE
 };
 
 struct Command {
@@ -125,13 +135,98 @@ struct ShowSprite : Command {
         index(index), x(x), y(y) {}
 };
 
+struct BeginFrame : Command {
+    BeginFrame() : Command(BEGIN_FRAME_OPCODE) {}
+};
+
+struct EndFrame : Command {
+    EndFrame() : Command(END_FRAME_OPCODE) {}
+};
+
 
 int width = 800;
 int height = 600;
 int orientation = 0;
+
+// Кадр усередині кільцевого буфера. Може переходити через край кільця,
+// тому складається з двох неперервних частин.
+struct RingView {
+    const uint8_t* first;
+    size_t firstSize;
+    const uint8_t* second;
+    size_t secondSize;
+
+    size_t size() const { return firstSize + secondSize; }
+    bool empty() const { return size() == 0; }
+    uint8_t operator[](size_t i) const {
+        return i < firstSize ? first[i] : second[i - firstSize];
+    }
+};
+
+inline void copyBytes(const std::vector<uint8_t>& bytes, size_t offset, size_t count, uint8_t* dst) {
+    if (count == 0) {
+        return;
+    }
+    std::memcpy(dst, bytes.data() + offset, count);
+}
+
+inline void copyBytes(const RingView& bytes, size_t offset, size_t count, uint8_t* dst) {
+    if (offset < bytes.firstSize) {
+        size_t head = bytes.firstSize - offset < count ? bytes.firstSize - offset : count;
+        std::memcpy(dst, bytes.first + offset, head);
+        dst += head;
+        count -= head;
+        offset = 0;
+    }
+    else {
+        offset -= bytes.firstSize;
+    }
+    if (count != 0) {
+        std::memcpy(dst, bytes.second + offset, count);
+    }
+}
+
+// Кільцевий буфер для потокових з'єднань. Ємність має бути степенем двійки.
+class RingBuffer {
+public:
+    explicit RingBuffer(size_t capacity) : storage(capacity), mask(capacity - 1), head(0), tail(0) {}
+
+    size_t size() const { return tail - head; }
+    size_t capacity() const { return storage.size(); }
+
+    // Найбільша неперервна вільна ділянка, куди можна читати з сокета
+    uint8_t* writePtr() { return &storage[tail & mask]; }
+    size_t writeSpace() const {
+        size_t freeSpace = capacity() - size();
+        size_t toEdge = capacity() - (tail & mask);
+        return freeSpace < toEdge ? freeSpace : toEdge;
+    }
+    void commit(size_t count) { tail += count; }
+
+    RingView view(size_t offset, size_t length) const {
+        size_t start = (head + offset) & mask;
+        size_t firstSize = capacity() - start < length ? capacity() - start : length;
+        return { &storage[start], firstSize, &storage[0], length - firstSize };
+    }
+
+    void consume(size_t count) {
+        head += count;
+        if (head == tail) {
+            head = tail = 0;
+        }
+    }
+
+private:
+    std::vector<uint8_t> storage;
+    size_t mask;
+    size_t head;
+    size_t tail;
+};
+
 class DisplayProtocol {
 public:
-    void parseCommand(const std::vector<uint8_t>& byteArray, Command*& command) {
+    template <typename Bytes>
+    void parseCommand(const Bytes& byteArray, Command*& command) {
         if (byteArray.empty()) {
             throw std::invalid_argument("Empty byte array");
         }
@@ -229,7 +324,8 @@ public:
             uint16_t color = parseColor(byteArray, 5);
 
            
-            std::string text(reinterpret_cast<const char*>(&byteArray[7]), byteArray.size() - 7);
+            std::string text(byteArray.size() - 7, '\0');
+            copyBytes(byteArray, 7, text.size(), reinterpret_cast<uint8_t*>(&text[0]));
 
             command = new Drawtext(x, y, color, text);
             break;
@@ -268,11 +364,12 @@ public:
             uint16_t height = parseInt16(byteArray, 5);
 
             size_t dataSize = byteArray.size() - 7;
-            if (dataSize != static_cast<size_t>(width * height * 3)) { // кожен піксель має 3 байти
+            if (dataSize != static_cast<size_t>(width) * height * 3) { // кожен піксель має 3 байти
                 throw std::invalid_argument("Sprite data size does not match dimensions");
             }
 
-            std::vector<uint8_t> data(byteArray.begin() + 7, byteArray.end());
+            std::vector<uint8_t> data(dataSize);
+            copyBytes(byteArray, 7, dataSize, data.data());
 
             command = new LoadSprite(index, width, height, data);
             break;
@@ -291,6 +388,20 @@ public:
             command = new ShowSprite(index, x, y);
             break;
         }
+        case BEGIN_FRAME_OPCODE: {
+            if (byteArray.size() != 1) {
+                throw std::invalid_argument("Invalid parameters for begin frame");
+            }
+            command = new BeginFrame();
+            break;
+        }
+        case END_FRAME_OPCODE: {
+            if (byteArray.size() != 1) {
+                throw std::invalid_argument("Invalid parameters for end frame");
+            }
+            command = new EndFrame();
+            break;
+        }
 
         default:
             throw std::invalid_argument("Invalid command opcode");
@@ -299,14 +410,16 @@ public:
 
 
 private:
-    uint16_t parseColor(const std::vector<uint8_t>& byteArray, size_t offset) {
+    template <typename Bytes>
+    uint16_t parseColor(const Bytes& byteArray, size_t offset) {
         if (offset + 1 >= byteArray.size()) {
             throw std::out_of_range("Invalid offset for parseColor");
         }
         return static_cast<uint16_t>((byteArray[offset] << 8) | byteArray[offset + 1]);
     }
 
-    int16_t parseInt16(const std::vector<uint8_t>& byteArray, size_t offset) {
+    template <typename Bytes>
+    int16_t parseInt16(const Bytes& byteArray, size_t offset) {
         if (offset + 1 >= byteArray.size()) {
             throw std::out_of_range("Invalid offset for parseInt16");
         }
@@ -327,6 +440,233 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
     return DefWindowProc(hwnd, uMsg, wParam, lParam);
 }
 
+// Кольори в командах завжди RGB565. Розгортання в 8 біт на канал рахуємо
+// один раз для всіх 65536 значень, а не ділимо для кожної команди чи пікселя.
+class ColorTable {
+public:
+    ColorTable() : xrgb(65536) {
+        for (uint32_t color = 0; color < 65536; ++color) {
+            uint32_t r = (((color >> 11) & 0x1F) * 255 + 15) / 31;
+            uint32_t g = (((color >> 5) & 0x3F) * 255 + 31) / 63;
+            uint32_t b = ((color & 0x1F) * 255 + 15) / 31;
+            xrgb[color] = (r << 16) | (g << 8) | b;
+        }
+    }
+
+    uint32_t toXrgb(uint16_t color) const { return xrgb[color]; }
+
+    COLORREF toColorRef(uint16_t color) const {
+        uint32_t value = xrgb[color];
+        return RGB((value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF);
+    }
+
+private:
+    std::vector<uint32_t> xrgb;
+};
+
+const ColorTable colorTable;
+
+enum PixelFormat {
+    PIXEL_FORMAT_RGB565,
+    PIXEL_FORMAT_RGB888,
+    PIXEL_FORMAT_XRGB8888
+};
+
+// Формати пікселів так, як вони лежать у DIB (little-endian):
+// Rgb888 зберігається як B, G, R, а Xrgb8888 як B, G, R, X.
+struct Rgb565 {
+    typedef uint16_t Pixel;
+    static const int BITS = 16;
+    static void fillRow(uint8_t* row, int count, Pixel pixel) {
+        std::fill_n(reinterpret_cast<uint16_t*>(row), count, pixel);
+    }
+};
+
+struct Rgb888 {
+    typedef uint32_t Pixel;
+    static const int BITS = 24;
+    static void fillRow(uint8_t* row, int count, Pixel pixel) {
+        uint8_t b = pixel & 0xFF, g = (pixel >> 8) & 0xFF, r = (pixel >> 16) & 0xFF;
+        for (int i = 0; i < count; ++i, row += 3) {
+            row[0] = b;
+            row[1] = g;
+            row[2] = r;
+        }
+    }
+};
+
+struct Xrgb8888 {
+    typedef uint32_t Pixel;
+    static const int BITS = 32;
+    static void fillRow(uint8_t* row, int count, Pixel pixel) {
+        std::fill_n(reinterpret_cast<uint32_t*>(row), count, pixel);
+    }
+};
+
+// Дані спрайтів надходять як байти R, G, B
+struct SpriteRgb {
+    static const int BYTES = 3;
+};
+
+// Перетворення кольору для кожної пари форматів (Dst, Src)
+template <typename Dst, typename Src>
+struct PixelConverter;
+
+template <>
+struct PixelConverter<Rgb565, Rgb565> {
+    static Rgb565::Pixel convert(uint16_t color) { return color; }
+};
+
+template <>
+struct PixelConverter<Rgb888, Rgb565> {
+    static Rgb888::Pixel convert(uint16_t color) { return colorTable.toXrgb(color); }
+};
+
+template <>
+struct PixelConverter<Xrgb8888, Rgb565> {
+    static Xrgb8888::Pixel convert(uint16_t color) { return colorTable.toXrgb(color); }
+};
+
+template <>
+struct PixelConverter<Rgb565, SpriteRgb> {
+    static Rgb565::Pixel convert(const uint8_t* rgb) {
+        return static_cast<uint16_t>(((rgb[0] & 0xF8) << 8) | ((rgb[1] & 0xFC) << 3) | (rgb[2] >> 3));
+    }
+};
+
+template <>
+struct PixelConverter<Rgb888, SpriteRgb> {
+    static Rgb888::Pixel convert(const uint8_t* rgb) { return (rgb[0] << 16) | (rgb[1] << 8) | rgb[2]; }
+};
+
+template <>
+struct PixelConverter<Xrgb8888, SpriteRgb> {
+    static Xrgb8888::Pixel convert(const uint8_t* rgb) { return (rgb[0] << 16) | (rgb[1] << 8) | rgb[2]; }
+};
+
+// Переводить прямокутник з логічних координат у координати буфера так само,
+// як світова трансформація з ApplyOrientation.
+RECT MapToDevice(const RECT& rect) {
+    int x0 = rect.left, y0 = rect.top, x1 = rect.right, y1 = rect.bottom;
+    switch (orientation) {
+    case 90:
+        x0 = height - rect.top; y0 = rect.left;
+        x1 = height - rect.bottom; y1 = rect.right;
+        break;
+    case 180:
+        x0 = width - rect.left; y0 = height - rect.top;
+        x1 = width - rect.right; y1 = height - rect.bottom;
+        break;
+    case 270:
+        x0 = rect.top; y0 = width - rect.left;
+        x1 = rect.bottom; y1 = width - rect.right;
+        break;
+    }
+    RECT mapped = { x0 < x1 ? x0 : x1, y0 < y1 ? y0 : y1, x0 < x1 ? x1 : x0, y0 < y1 ? y1 : y0 };
+    return mapped;
+}
+
+// Пряме малювання у пікселі заднього буфера. Кольори приходять у RGB565
+// і перетворюються у формат буфера один раз на команду.
+class RenderSurface {
+public:
+    virtual ~RenderSurface() {}
+    virtual void clear(uint16_t color) = 0;
+    virtual void fill(const RECT& rect, uint16_t color) = 0;
+    virtual void drawSprite(const uint8_t* rgb, int spriteWidth, int spriteHeight, int x, int y, int scale) = 0;
+};
+
+template <typename Format>
+class Surface : public RenderSurface {
+public:
+    Surface(uint8_t* bits, int stride, int surfaceWidth, int surfaceHeight)
+        : bits(bits), stride(stride), surfaceWidth(surfaceWidth), surfaceHeight(surfaceHeight) {}
+
+    void clear(uint16_t color) override {
+        GdiFlush();
+        RECT rect = { 0, 0, surfaceWidth, surfaceHeight };
+        fillDevice(rect, PixelConverter<Format, Rgb565>::convert(color));
+    }
+
+    void fill(const RECT& rect, uint16_t color) override {
+        GdiFlush();
+        fillDevice(MapToDevice(rect), PixelConverter<Format, Rgb565>::convert(color));
+    }
+
+    // Кожен піксель спрайта стає квадратом scale x scale
+    void drawSprite(const uint8_t* rgb, int spriteWidth, int spriteHeight, int x, int y, int scale) override {
+        GdiFlush();
+        for (int row = 0; row < spriteHeight; ++row) {
+            for (int col = 0; col < spriteWidth; ++col, rgb += SpriteRgb::BYTES) {
+                RECT block = { x + col * scale, y + row * scale, x + (col + 1) * scale, y + (row + 1) * scale };
+                fillDevice(MapToDevice(block), PixelConverter<Format, SpriteRgb>::convert(rgb));
+            }
+        }
+    }
+
+private:
+    void fillDevice(RECT rect, typename Format::Pixel pixel) {
+        if (rect.left < 0) rect.left = 0;
+        if (rect.top < 0) rect.top = 0;
+        if (rect.right > surfaceWidth) rect.right = surfaceWidth;
+        if (rect.bottom > surfaceHeight) rect.bottom = surfaceHeight;
+        if (rect.left >= rect.right || rect.top >= rect.bottom) {
+            return;
+        }
+        uint8_t* row = bits + rect.top * stride + rect.left * (Format::BITS / 8);
+        for (int y = rect.top; y < rect.bottom; ++y, row += stride) {
+            Format::fillRow(row, rect.right - rect.left, pixel);
+        }
+    }
+
+    uint8_t* bits;
+    int stride;
+    int surfaceWidth;
+    int surfaceHeight;
+};
+
+template <typename Format>
+HBITMAP CreateSurfaceBitmap(HDC dc, int surfaceWidth, int surfaceHeight, RenderSurface*& surface) {
+    struct {
+        BITMAPINFOHEADER bmiHeader;
+        DWORD masks[3];
+    } info = {};
+    info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    info.bmiHeader.biWidth = surfaceWidth;
+    info.bmiHeader.biHeight = -surfaceHeight; // рядки зверху вниз
+    info.bmiHeader.biPlanes = 1;
+    info.bmiHeader.biBitCount = Format::BITS;
+    info.bmiHeader.biCompression = BI_RGB;
+    if (Format::BITS == 16) {
+        info.bmiHeader.biCompression = BI_BITFIELDS;
+        info.masks[0] = 0xF800;
+        info.masks[1] = 0x07E0;
+        info.masks[2] = 0x001F;
+    }
+
+    void* bits = nullptr;
+    HBITMAP bitmap = CreateDIBSection(dc, reinterpret_cast<BITMAPINFO*>(&info), DIB_RGB_COLORS, &bits, NULL, 0);
+    if (bitmap == NULL) {
+        throw std::runtime_error("Error creating surface bitmap");
+    }
+    int stride = (surfaceWidth * Format::BITS + 31) / 32 * 4;
+    surface = new Surface<Format>(static_cast<uint8_t*>(bits), stride, surfaceWidth, surfaceHeight);
+    return bitmap;
+}
+
+HBITMAP CreateSurfaceBitmap(PixelFormat format, HDC dc, int surfaceWidth, int surfaceHeight, RenderSurface*& surface) {
+    switch (format) {
+    case PIXEL_FORMAT_RGB565:
+        return CreateSurfaceBitmap<Rgb565>(dc, surfaceWidth, surfaceHeight, surface);
+    case PIXEL_FORMAT_RGB888:
+        return CreateSurfaceBitmap<Rgb888>(dc, surfaceWidth, surfaceHeight, surface);
+    default:
+        return CreateSurfaceBitmap<Xrgb8888>(dc, surfaceWidth, surfaceHeight, surface);
+    }
+}
+
+RenderSurface* surface = nullptr;
+
 
 void drawCharacter(HDC hdc, char c, int x, int y, uint16_t color, float scale) {
     const int baseWidth = 40;
@@ -334,7 +674,7 @@ void drawCharacter(HDC hdc, char c, int x, int y, uint16_t color, float scale) {
     const int width = baseWidth * scale;
     const int height = baseHeight * scale;
 
-    HPEN pen = CreatePen(PS_SOLID, 1, RGB((color >> 8) & 0xFF, color & 0xFF, 0));
+    HPEN pen = CreatePen(PS_SOLID, 1, colorTable.toColorRef(color));
     SelectObject(hdc, pen);
 
     int startX = x;
@@ -443,34 +783,459 @@ void drawCharacter(HDC hdc, char c, int x, int y, uint16_t color, float scale) {
 
 
 
-std::map<uint16_t, std::vector<uint8_t>> spriteStorage;
+// Поворот задається світовою трансформацією контексту, тому її треба
+// відновлювати для кожного буфера, в який малюємо.
+void ApplyOrientation(HDC dc) {
+    switch (orientation) {
+    case 0:
+        SetGraphicsMode(dc, GM_ADVANCED);
+        ModifyWorldTransform(dc, NULL, MWT_IDENTITY);
+        break;
+
+    case 90:
+        SetGraphicsMode(dc, GM_ADVANCED);
+        {
+            XFORM xform = { 0 };
+            xform.eM11 = 0.0f;
+            xform.eM12 = 1.0f;
+            xform.eM21 = -1.0f;
+            xform.eM22 = 0.0f;
+            xform.eDx = height;
+            xform.eDy = 0.0f;
+            SetWorldTransform(dc, &xform);
+        }
+        break;
+
+    case 180:
+        SetGraphicsMode(dc, GM_ADVANCED);
+        {
+            XFORM xform = { 0 };
+            xform.eM11 = -1.0f;
+            xform.eM12 = 0.0f;
+            xform.eM21 = 0.0f;
+            xform.eM22 = -1.0f;
+            xform.eDx = width;
+            xform.eDy = height;
+            SetWorldTransform(dc, &xform);
+        }
+        break;
+
+    case 270:
+        SetGraphicsMode(dc, GM_ADVANCED);
+        {
+            XFORM xform = { 0 };
+            xform.eM11 = 0.0f;
+            xform.eM12 = -1.0f;
+            xform.eM21 = 1.0f;
+            xform.eM22 = 0.0f;
+            xform.eDx = 0.0f;
+            xform.eDy = width;
+            SetWorldTransform(dc, &xform);
+        }
+        break;
+
+    default:
+        std::cerr << "Invalid orientation value: " << orientation << std::endl;
+        break;
+    }
+}
+
+struct Sprite {
+    uint16_t width;
+    uint16_t height;
+    std::vector<uint8_t> data;
+};
+
+std::map<uint16_t, Sprite> spriteStorage;
+
+// Спрайт, дані якого лежать деінде (у spriteStorage або у відображеному файлі).
+// Вказівник дійсний лише до наступного збереження спрайта.
+struct SpriteView {
+    uint16_t width;
+    uint16_t height;
+    const uint8_t* data;
+};
+
+// Постійний кеш спрайтів: один файл з індексом на всі 65536 номерів і ареною
+// пікселів, відображений у пам'ять. Після перезапуску спрайти доступні одразу,
+// без розбору. Нові дані лише дописуються в кінець арени, а заміщені
+// звільняються стисканням у новий файл, який потім підміняє старий.
+//
+// Кожен номер має два записи індексу. Новий спрайт пишеться в неактуальний
+// запис і публікується одним записом його sequence, тож збій процесу посеред
+// заміни лишає попередній спрайт. Межі записів перевіряються при відкритті,
+// а контрольна сума при першому зверненні до спрайта.
+class PersistentSpriteCache {
+public:
+    ~PersistentSpriteCache() { close(); }
+
+    bool open(const std::string& cachePath) {
+        if (!openFile(cachePath, OPEN_ALWAYS)) {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(file, &fileSize) && static_cast<uint64_t>(fileSize.QuadPart) > arenaOffset()) {
+            if (!map(0)) {
+                close();
+                return false;
+            }
+            if (isValid(fileSize.QuadPart)) {
+                verified.assign(SPRITE_SLOTS, 0);
+                validateIndex();
+                return true;
+            }
+            std::cerr << "Sprite cache " << path << " is corrupted, starting empty" << std::endl;
+            unmap();
+        }
+        return initialize(INITIAL_ARENA_SIZE);
+    }
+
+    void close() {
+        if (view != nullptr) {
+            FlushViewOfFile(view, 0);
+        }
+        unmap();
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    bool isOpen() const { return view != nullptr; }
+
+    size_t count() const {
+        size_t sprites = 0;
+        for (size_t i = 0; i < SPRITE_SLOTS; ++i) {
+            if (current(i) != nullptr) {
+                ++sprites;
+            }
+        }
+        return sprites;
+    }
+
+    bool store(uint16_t index, uint16_t spriteWidth, uint16_t spriteHeight, const std::vector<uint8_t>& data) {
+        if (data.size() != static_cast<uint64_t>(spriteWidth) * spriteHeight * 3
+            || data.size() > UINT32_MAX || !reserve(data.size())) {
+            return false;
+        }
+        Header* cacheHeader = header();
+        uint64_t offset = cacheHeader->arenaUsed;
+        if (!data.empty()) {
+            std::memcpy(arena() + offset, data.data(), data.size());
+        }
+        MemoryBarrier();
+        cacheHeader->arenaUsed += data.size();
+
+        // Старий запис і його дані не змінюються, доки новий не опубліковано
+        Entry* previous = current(index);
+        Entry& entry = slots()[index].entries[previous == &slots()[index].entries[0] ? 1 : 0];
+        entry.sequence = 0;
+        entry.offset = offset;
+        entry.size = static_cast<uint32_t>(data.size());
+        entry.checksum = checksum(data.data(), data.size());
+        entry.width = spriteWidth;
+        entry.height = spriteHeight;
+        MemoryBarrier();
+        entry.sequence = previous != nullptr ? previous->sequence + 1 : 1;
+
+        // liveBytes лише підказка для стискання: при відкритті її перераховано
+        if (previous != nullptr) {
+            cacheHeader->liveBytes -= previous->size;
+        }
+        cacheHeader->liveBytes += entry.size;
+        verified[index] = 1;
+        return true;
+    }
+
+    bool find(uint16_t index, SpriteView& sprite) {
+        while (Entry* entry = current(index)) {
+            const uint8_t* data = arena() + entry->offset;
+            if (verified[index] || checksum(data, entry->size) == entry->checksum) {
+                verified[index] = 1;
+                sprite = { entry->width, entry->height, data };
+                return true;
+            }
+            // Якщо є попередня версія спрайта, далі перевіряється вона
+            std::cerr << "Sprite with index " << index << " is corrupted in cache, dropping it" << std::endl;
+            entry->sequence = 0;
+            header()->liveBytes = countLiveBytes();
+        }
+        return false;
+    }
+
+private:
+    static const uint32_t MAGIC = 0x43533353; // "S3SC"
+    static const uint32_t VERSION = 2;
+    static const size_t SPRITE_SLOTS = 65536;
+    static const uint64_t INITIAL_ARENA_SIZE = 4 << 20;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t arenaSize;
+        uint64_t arenaUsed;
+        uint64_t liveBytes;
+    };
+
+    struct Entry {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t checksum;
+        uint16_t width;
+        uint16_t height;
+        uint32_t sequence; // 0 — запис порожній
+    };
+
+    struct Slot {
+        Entry entries[2];
+    };
+
+    static uint64_t arenaOffset() { return sizeof(Header) + SPRITE_SLOTS * sizeof(Slot); }
+
+    Header* header() const { return reinterpret_cast<Header*>(view); }
+    Slot* slots() const { return reinterpret_cast<Slot*>(view + sizeof(Header)); }
+    uint8_t* arena() const { return view + arenaOffset(); }
+
+    // Актуальний запис номера — непорожній з більшим sequence
+    Entry* current(size_t index) const {
+        Entry* entries = slots()[index].entries;
+        if (entries[0].sequence == 0 && entries[1].sequence == 0) {
+            return nullptr;
+        }
+        return entries[0].sequence > entries[1].sequence ? &entries[0] : &entries[1];
+    }
+
+    bool inBounds(const Entry& entry) const {
+        uint64_t arenaUsed = header()->arenaUsed;
+        return entry.offset <= arenaUsed && entry.size <= arenaUsed - entry.offset
+            && entry.size == static_cast<uint64_t>(entry.width) * entry.height * 3;
+    }
+
+    uint64_t countLiveBytes() const {
+        uint64_t liveBytes = 0;
+        for (size_t i = 0; i < SPRITE_SLOTS; ++i) {
+            if (const Entry* entry = current(i)) {
+                liveBytes += entry->size;
+            }
+        }
+        return liveBytes;
+    }
+
+    // Індекс після збою може містити будь-що: відкидаємо записи, що виходять
+    // за межі арени, і перераховуємо liveBytes замість довіри заголовку
+    void validateIndex() {
+        size_t dropped = 0;
+        for (size_t i = 0; i < SPRITE_SLOTS; ++i) {
+            for (Entry& entry : slots()[i].entries) {
+                if (entry.sequence != 0 && !inBounds(entry)) {
+                    entry.sequence = 0;
+                    ++dropped;
+                }
+            }
+        }
+        if (dropped != 0) {
+            std::cerr << "Sprite cache " << path << ": dropped " << dropped << " invalid index entries" << std::endl;
+        }
+        header()->liveBytes = countLiveBytes();
+    }
+
+    // FNV-1a
+    static uint32_t checksum(const uint8_t* data, size_t size) {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ data[i]) * 16777619u;
+        }
+        return hash;
+    }
+
+    bool openFile(const std::string& cachePath, DWORD disposition) {
+        close();
+        path = cachePath;
+        file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+        return file != INVALID_HANDLE_VALUE;
+    }
+
+    // Розмір 0 відображає файл повністю; більший розмір спершу розширює файл
+    bool map(uint64_t size) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), NULL);
+        if (mapping == NULL) {
+            return false;
+        }
+        view = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+        if (view == nullptr) {
+            CloseHandle(mapping);
+            mapping = NULL;
+            return false;
+        }
+        return true;
+    }
+
+    void unmap() {
+        if (view != nullptr) {
+            UnmapViewOfFile(view);
+            view = nullptr;
+        }
+        if (mapping != NULL) {
+            CloseHandle(mapping);
+            mapping = NULL;
+        }
+    }
+
+    // open() викликає лише для fileSize > arenaOffset(), тож віднімання не переповнюється
+    bool isValid(uint64_t fileSize) const {
+        const Header* cacheHeader = header();
+        return cacheHeader->magic == MAGIC && cacheHeader->version == VERSION
+            && cacheHeader->arenaSize <= fileSize - arenaOffset()
+            && cacheHeader->arenaUsed <= cacheHeader->arenaSize;
+    }
+
+    bool initialize(uint64_t arenaSize) {
+        if (!map(arenaOffset() + arenaSize)) {
+            close();
+            return false;
+        }
+        std::memset(view, 0, static_cast<size_t>(arenaOffset()));
+        Header* cacheHeader = header();
+        cacheHeader->magic = MAGIC;
+        cacheHeader->version = VERSION;
+        cacheHeader->arenaSize = arenaSize;
+        cacheHeader->arenaUsed = 0;
+        cacheHeader->liveBytes = 0;
+        verified.assign(SPRITE_SLOTS, 0);
+        return true;
+    }
+
+    // Звільняє місце для size байтів: стискає арену, якщо більше половини
+    // її займають заміщені дані, інакше розширює файл удвічі
+    bool reserve(uint64_t size) {
+        Header* cacheHeader = header();
+        if (cacheHeader->arenaUsed + size <= cacheHeader->arenaSize) {
+            return true;
+        }
+        if (cacheHeader->liveBytes <= cacheHeader->arenaUsed - cacheHeader->arenaUsed / 2) {
+            if (!compact(size)) {
+                return false;
+            }
+            cacheHeader = header();
+            if (cacheHeader->arenaUsed + size <= cacheHeader->arenaSize) {
+                return true;
+            }
+        }
+        uint64_t arenaSize = cacheHeader->arenaSize * 2;
+        while (arenaSize < cacheHeader->arenaUsed + size) {
+            arenaSize *= 2;
+        }
+        return grow(arenaSize);
+    }
+
+    bool grow(uint64_t arenaSize) {
+        unmap();
+        if (!map(arenaOffset() + arenaSize)) {
+            std::cerr << "Error growing sprite cache " << path << std::endl;
+            if (!map(0)) {
+                close();
+            }
+            return false;
+        }
+        header()->arenaSize = arenaSize;
+        return true;
+    }
+
+    // Живі спрайти копіюються в новий файл, який замінює поточний лише
+    // після повного запису, тож збій посеред стискання не псує кеш
+    bool compact(uint64_t extra) {
+        std::string tempPath = path + ".tmp";
+        uint64_t liveBytes = 0;
+        for (size_t i = 0; i < SPRITE_SLOTS; ++i) {
+            const Entry* entry = current(i);
+            if (entry != nullptr && inBounds(*entry)) {
+                liveBytes += entry->size;
+            }
+        }
+        uint64_t arenaSize = (liveBytes + extra) * 2;
+        if (arenaSize < INITIAL_ARENA_SIZE) {
+            arenaSize = INITIAL_ARENA_SIZE;
+        }
+
+        PersistentSpriteCache compacted;
+        if (!compacted.openFile(tempPath, CREATE_ALWAYS) || !compacted.initialize(arenaSize)) {
+            std::cerr << "Error compacting sprite cache " << path << std::endl;
+            return false;
+        }
+        Header* target = compacted.header();
+        for (size_t i = 0; i < SPRITE_SLOTS; ++i) {
+            const Entry* entry = current(i);
+            if (entry == nullptr || !inBounds(*entry)) {
+                continue;
+            }
+            Entry& copy = compacted.slots()[i].entries[0];
+            copy = *entry;
+            copy.offset = target->arenaUsed;
+            copy.sequence = 1;
+            std::memcpy(compacted.arena() + copy.offset, arena() + entry->offset, entry->size);
+            target->arenaUsed += entry->size;
+            target->liveBytes += entry->size;
+        }
+        compacted.close();
+
+        std::string cachePath = path;
+        close();
+        if (!MoveFileExA(tempPath.c_str(), cachePath.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+            std::cerr << "Error replacing sprite cache " << cachePath << std::endl;
+            DeleteFileA(tempPath.c_str());
+        }
+        return open(cachePath);
+    }
+
+    std::string path;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+    uint8_t* view = nullptr;
+    std::vector<uint8_t> verified;
+};
+
+PersistentSpriteCache spriteCache;
+
+// SHOW_SPRITE читає рівно width * height * 3 байти, тому інший розмір даних не приймаємо
+bool StoreSprite(uint16_t index, uint16_t spriteWidth, uint16_t spriteHeight, const std::vector<uint8_t>& data) {
+    if (data.size() != static_cast<size_t>(spriteWidth) * spriteHeight * 3) {
+        return false;
+    }
+    if (spriteCache.isOpen() && spriteCache.store(index, spriteWidth, spriteHeight, data)) {
+        spriteStorage.erase(index);
+        return true;
+    }
+    spriteStorage[index] = { spriteWidth, spriteHeight, data };
+    return true;
+}
+
+bool FindSprite(uint16_t index, SpriteView& sprite) {
+    auto it = spriteStorage.find(index);
+    if (it != spriteStorage.end()) {
+        sprite = { it->second.width, it->second.height, it->second.data.data() };
+        return true;
+    }
+    return spriteCache.isOpen() && spriteCache.find(index, sprite);
+}
 
 void DrawCommand(Command* command) {
     switch (command->opcode) {
 
     case CLEAR_DISPLAY_OPCODE: {
         fillScreen* clearCommand = static_cast<fillScreen*>(command);
-        int r = ((clearCommand->color >> 11) & 0x1F) * 255 / 31;
-        int g = ((clearCommand->color >> 5) & 0x3F) * 255 / 63;
-        int b = (clearCommand->color & 0x1F) * 255 / 31;
-        HBRUSH brush = CreateSolidBrush(RGB(r, g, b));
-        RECT rect = { 0, 0, 800, 600 };
-        FillRect(hdc, &rect, brush);
-        DeleteObject(brush);
+        surface->clear(clearCommand->color);
         break;
     }
     case DRAW_PIXEL_OPCODE: {
         DrawPixel* pixelCommand = static_cast<DrawPixel*>(command);
         int pixelSize = 10;
-        HBRUSH brush = CreateSolidBrush(RGB((pixelCommand->color >> 8) & 0xFF, pixelCommand->color & 0xFF, 0));
         RECT rect = { pixelCommand->newX, pixelCommand->newY, pixelCommand->newX + pixelSize, pixelCommand->newY + pixelSize };
-        FillRect(hdc, &rect, brush);
-        DeleteObject(brush);
+        surface->fill(rect, pixelCommand->color);
         break;
     }
     case DRAW_LINE_OPCODE: {
         DrawLine* lineCommand = static_cast<DrawLine*>(command);
-        HPEN pen = CreatePen(PS_SOLID, 1, RGB((lineCommand->color >> 8) & 0xFF, lineCommand->color & 0xFF, 0));
+        HPEN pen = CreatePen(PS_SOLID, 1, colorTable.toColorRef(lineCommand->color));
         SelectObject(hdc, pen);
         MoveToEx(hdc, lineCommand->x0, lineCommand->y0, NULL);
         LineTo(hdc, lineCommand->x1, lineCommand->y1);
@@ -479,8 +1244,8 @@ void DrawCommand(Command* command) {
     }
     case DRAW_RECTANGLE_OPCODE: {
         DrawRectangle* rectCommand = static_cast<DrawRectangle*>(command);
-        HBRUSH brush = CreateSolidBrush(RGB((rectCommand->color >> 8) & 0xFF, rectCommand->color & 0xFF, 0));
-        HPEN pen = CreatePen(PS_SOLID, 1, RGB((rectCommand->color >> 8) & 0xFF, rectCommand->color & 0xFF, 0));
+        HBRUSH brush = CreateSolidBrush(colorTable.toColorRef(rectCommand->color));
+        HPEN pen = CreatePen(PS_SOLID, 1, colorTable.toColorRef(rectCommand->color));
         SelectObject(hdc, brush);
         SelectObject(hdc, pen);
         Rectangle(hdc, rectCommand->x0, rectCommand->y0, rectCommand->x1, rectCommand->y1);
@@ -490,16 +1255,13 @@ void DrawCommand(Command* command) {
     }
     case FILL_RECTANGLE_OPCODE: {
         FillRectangle* fillRectCommand = static_cast<FillRectangle*>(command);
-        HBRUSH brush = CreateSolidBrush(RGB((fillRectCommand->color >> 8) & 0xFF, fillRectCommand->color & 0xFF, 0));
-        SelectObject(hdc, brush);
         RECT rect = { fillRectCommand->x0, fillRectCommand->y0, fillRectCommand->x1, fillRectCommand->y1 };
-        FillRect(hdc, &rect, brush);
-        DeleteObject(brush);
+        surface->fill(rect, fillRectCommand->color);
         break;
     }
     case DRAW_ELLIPSE_OPCODE: {
         DrawEllipse* ellipseCommand = static_cast<DrawEllipse*>(command);
-        HPEN pen = CreatePen(PS_SOLID, 1, RGB((ellipseCommand->color >> 8) & 0xFF, ellipseCommand->color & 0xFF, 0));
+        HPEN pen = CreatePen(PS_SOLID, 1, colorTable.toColorRef(ellipseCommand->color));
         SelectObject(hdc, pen);
         Ellipse(hdc, ellipseCommand->x0 - ellipseCommand->rx, ellipseCommand->y0 - ellipseCommand->ry,
             ellipseCommand->x0 + ellipseCommand->rx, ellipseCommand->y0 + ellipseCommand->ry);
@@ -508,7 +1270,7 @@ void DrawCommand(Command* command) {
     }
     case FILL_ELLIPSE_OPCODE: {
         FillEllipse* fillEllipseCommand = static_cast<FillEllipse*>(command);
-        HBRUSH brush = CreateSolidBrush(RGB((fillEllipseCommand->color >> 8) & 0xFF, fillEllipseCommand->color & 0xFF, 0));
+        HBRUSH brush = CreateSolidBrush(colorTable.toColorRef(fillEllipseCommand->color));
         SelectObject(hdc, brush);
         Ellipse(hdc, fillEllipseCommand->x0 - fillEllipseCommand->rx, fillEllipseCommand->y0 - fillEllipseCommand->ry,
             fillEllipseCommand->x0 + fillEllipseCommand->rx, fillEllipseCommand->y0 + fillEllipseCommand->ry);
@@ -530,58 +1292,7 @@ void DrawCommand(Command* command) {
         SetOrientation* setOrientationCommand = static_cast<SetOrientation*>(command);
         orientation = setOrientationCommand->orientation;
 
-        switch (orientation) {
-        case 0:
-            SetGraphicsMode(hdc, GM_ADVANCED);
-            ModifyWorldTransform(hdc, NULL, MWT_IDENTITY);
-            break;
-
-        case 90:
-            SetGraphicsMode(hdc, GM_ADVANCED);
-            {
-                XFORM xform = { 0 };
-                xform.eM11 = 0.0f;
-                xform.eM12 = 1.0f;
-                xform.eM21 = -1.0f;
-                xform.eM22 = 0.0f;
-                xform.eDx = height;
-                xform.eDy = 0.0f;
-                SetWorldTransform(hdc, &xform);
-            }
-            break;
-
-        case 180:
-            SetGraphicsMode(hdc, GM_ADVANCED);
-            {
-                XFORM xform = { 0 };
-                xform.eM11 = -1.0f;
-                xform.eM12 = 0.0f;
-                xform.eM21 = 0.0f;
-                xform.eM22 = -1.0f;
-                xform.eDx = width;
-                xform.eDy = height;
-                SetWorldTransform(hdc, &xform);
-            }
-            break;
-
-        case 270:
-            SetGraphicsMode(hdc, GM_ADVANCED);
-            {
-                XFORM xform = { 0 };
-                xform.eM11 = 0.0f;
-                xform.eM12 = -1.0f;
-                xform.eM21 = 1.0f;
-                xform.eM22 = 0.0f;
-                xform.eDx = 0.0f;
-                xform.eDy = width;
-                SetWorldTransform(hdc, &xform);
-            }
-            break;
-
-        default:
-            std::cerr << "Invalid orientation value: " << orientation << std::endl;
-            break;
-        }
+        ApplyOrientation(hdc);
 
         std::cout << "Orientation set to: " << orientation << " degrees" << std::endl;
         break;
@@ -600,7 +1311,10 @@ void DrawCommand(Command* command) {
         LoadSprite* loadSpriteCommand = static_cast<LoadSprite*>(command);
 
        
-        spriteStorage[loadSpriteCommand->index] = loadSpriteCommand->data;
+        if (!StoreSprite(loadSpriteCommand->index, loadSpriteCommand->width, loadSpriteCommand->height, loadSpriteCommand->data)) {
+            std::cerr << "Error: Sprite data size does not match dimensions for index " << loadSpriteCommand->index << std::endl;
+            break;
+        }
 
         std::cout << "Sprite with index " << loadSpriteCommand->index
             << " loaded (" << loadSpriteCommand->width << "x" << loadSpriteCommand->height << ")." << std::endl;
@@ -610,28 +1324,13 @@ void DrawCommand(Command* command) {
     case SHOW_SPRITE_OPCODE: {
         ShowSprite* showSpriteCommand = static_cast<ShowSprite*>(command);
 
-        auto it = spriteStorage.find(showSpriteCommand->index);
-        if (it == spriteStorage.end()) {
+        SpriteView sprite;
+        if (!FindSprite(showSpriteCommand->index, sprite)) {
             std::cerr << "Error: Sprite with index " << showSpriteCommand->index << " not found!" << std::endl;
             break;
         }
 
-        const std::vector<uint8_t>& spriteData = it->second;
-
-        for (int row = 0; row < 16; ++row) {
-            for (int col = 0; col < 16; ++col) {
-                int pixelIndex = (row * 16 + col) * 3; 
-                uint8_t red = spriteData[pixelIndex];
-                uint8_t green = spriteData[pixelIndex + 1];
-                uint8_t blue = spriteData[pixelIndex + 2];
-
-                HBRUSH brush = CreateSolidBrush(RGB(red, green, blue));
-                RECT rect = { showSpriteCommand->x + col * 10, showSpriteCommand->y + row * 10,
-                              showSpriteCommand->x + (col + 1) * 10, showSpriteCommand->y + (row + 1) * 10 };
-                FillRect(hdc, &rect, brush);
-                DeleteObject(brush);
-            }
-        }
+        surface->drawSprite(sprite.data, sprite.width, sprite.height, showSpriteCommand->x, showSpriteCommand->y, 10);
 
         std::cout << "Sprite with index " << showSpriteCommand->index
             << " shown at (" << showSpriteCommand->x << ", " << showSpriteCommand->y << ")." << std::endl;
@@ -639,10 +1338,256 @@ void DrawCommand(Command* command) {
     }
 
 
-   
+
     }
 }
 
+// BitBlt не приймає повернуте джерело, тому копіюємо в одиничній трансформації
+void CopySurface(HDC dst, HDC src) {
+    XFORM dstXform, srcXform;
+    GetWorldTransform(dst, &dstXform);
+    GetWorldTransform(src, &srcXform);
+    ModifyWorldTransform(dst, NULL, MWT_IDENTITY);
+    ModifyWorldTransform(src, NULL, MWT_IDENTITY);
+    BitBlt(dst, 0, 0, width, height, src, 0, 0, SRCCOPY);
+    SetWorldTransform(dst, &dstXform);
+    SetWorldTransform(src, &srcXform);
+}
+
+const UINT_PTR FRAME_TIMEOUT_TIMER = 1;
+const size_t FRAME_STATS_INTERVAL = 60;
+
+enum FrameEnd {
+    FRAME_COMPLETE,
+    FRAME_TIMED_OUT,
+    FRAME_INTERRUPTED   // новий BEGIN_FRAME до END_FRAME
+};
+
+struct FrameStats {
+    size_t frames = 0;
+    size_t timeouts = 0;
+    size_t interrupted = 0;
+    size_t commands = 0;
+    double renderMs = 0;
+    size_t presents = 0;
+    double presentMs = 0;
+};
+
+// Команди між BEGIN_FRAME і END_FRAME малюються у задній буфер, а на екран
+// потрапляють лише цілим кадром. Команди поза кадром показуються одразу,
+// щойно в черзі не залишиться інших команд.
+//
+// При потрійній буферизації показ виконує окремий потік: рендер лише
+// обмінюється з ним індексами буферів і ніколи не чекає на BitBlt у вікно.
+class FrameRenderer {
+public:
+    void create(HWND window, PixelFormat pixelFormat, bool tripleBuffering, int frameTimeoutMs) {
+        this->window = window;
+        this->tripleBuffering = tripleBuffering;
+        this->frameTimeoutMs = frameTimeoutMs;
+        windowDC = GetDC(window);
+
+        int count = tripleBuffering ? 3 : 1;
+        for (int i = 0; i < count; ++i) {
+            Buffer buffer;
+            buffer.dc = CreateCompatibleDC(windowDC);
+            buffer.bitmap = CreateSurfaceBitmap(pixelFormat, windowDC, width, height, buffer.surface);
+            SelectObject(buffer.dc, buffer.bitmap);
+            SetGraphicsMode(buffer.dc, GM_ADVANCED);
+            buffers.push_back(buffer);
+        }
+        renderIndex = 0;
+        readyIndex = 1;
+        presentIndex = 2;
+        hdc = buffers[renderIndex].dc;
+        surface = buffers[renderIndex].surface;
+
+        if (tripleBuffering) {
+            presenter = std::thread(&FrameRenderer::presenterLoop, this);
+        }
+    }
+
+    void destroy() {
+        if (presenter.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            frameReady.notify_one();
+            presenter.join();
+        }
+        for (Buffer& buffer : buffers) {
+            DeleteDC(buffer.dc);
+            DeleteObject(buffer.bitmap);
+            delete buffer.surface;
+        }
+        buffers.clear();
+        ReleaseDC(window, windowDC);
+    }
+
+    void execute(Command* command) {
+        switch (command->opcode) {
+        case BEGIN_FRAME_OPCODE:
+            if (inFrame) {
+                std::cerr << "BEGIN_FRAME inside a frame, presenting the previous one" << std::endl;
+                endFrame(FRAME_INTERRUPTED);
+            }
+            inFrame = true;
+            frameCommands = 0;
+            frameRenderMs = 0;
+            frameDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(frameTimeoutMs);
+            SetTimer(window, FRAME_TIMEOUT_TIMER, frameTimeoutMs, NULL);
+            break;
+
+        case END_FRAME_OPCODE:
+            if (!inFrame) {
+                std::cerr << "END_FRAME without BEGIN_FRAME" << std::endl;
+                break;
+            }
+            endFrame(FRAME_COMPLETE);
+            break;
+
+        default: {
+            auto start = std::chrono::steady_clock::now();
+            DrawCommand(command);
+            double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (inFrame) {
+                ++frameCommands;
+                frameRenderMs += elapsedMs;
+                // Поки в черзі є команди, WM_TIMER не надходить, тому строк кадру
+                // перевіряємо й тут
+                if (std::chrono::steady_clock::now() >= frameDeadline) {
+                    onTimeout();
+                }
+            }
+            else {
+                // Під постійним навантаженням черга не спорожняється, тому
+                // показуємо не рідше, ніж раз на frameTimeoutMs
+                MSG pending;
+                if (!PeekMessage(&pending, NULL, WM_USER + 1, WM_USER + 1, PM_NOREMOVE)
+                    || std::chrono::steady_clock::now() - lastPresent >= std::chrono::milliseconds(frameTimeoutMs)) {
+                    present();
+                }
+            }
+            break;
+        }
+        }
+    }
+
+    // END_FRAME не надійшов вчасно: показуємо те, що встигли намалювати
+    void onTimeout() {
+        if (inFrame) {
+            std::cerr << "Frame timed out after " << frameCommands << " commands" << std::endl;
+            endFrame(FRAME_TIMED_OUT);
+        }
+        else {
+            KillTimer(window, FRAME_TIMEOUT_TIMER);
+        }
+    }
+
+private:
+    struct Buffer {
+        HDC dc;
+        HBITMAP bitmap;
+        RenderSurface* surface;
+    };
+
+    void endFrame(FrameEnd reason) {
+        KillTimer(window, FRAME_TIMEOUT_TIMER);
+        inFrame = false;
+        present();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        ++stats.frames;
+        if (reason == FRAME_TIMED_OUT) {
+            ++stats.timeouts;
+        }
+        else if (reason == FRAME_INTERRUPTED) {
+            ++stats.interrupted;
+        }
+        stats.commands += frameCommands;
+        stats.renderMs += frameRenderMs;
+        if (stats.frames % FRAME_STATS_INTERVAL == 0) {
+            std::cout << "Frames: " << stats.frames << " (" << stats.timeouts << " timed out, " << stats.interrupted << " interrupted)"
+                << ", commands/frame: " << static_cast<double>(stats.commands) / stats.frames
+                << ", render ms: " << stats.renderMs / stats.frames
+                << ", present ms: " << (stats.presents != 0 ? stats.presentMs / stats.presents : 0.0) << std::endl;
+        }
+    }
+
+    void present() {
+        lastPresent = std::chrono::steady_clock::now();
+        if (!tripleBuffering) {
+            auto start = std::chrono::steady_clock::now();
+            CopySurface(windowDC, hdc);
+            double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::lock_guard<std::mutex> lock(mutex);
+            ++stats.presents;
+            stats.presentMs += elapsedMs;
+            return;
+        }
+
+        {
+            // Готовий кадр віддаємо потоку показу, а новий задній буфер
+            // починаємо з його копії, щоб наступні команди домальовували кадр
+            std::lock_guard<std::mutex> lock(mutex);
+            std::swap(renderIndex, readyIndex);
+            readyPending = true;
+            CopySurface(buffers[renderIndex].dc, buffers[readyIndex].dc);
+        }
+        frameReady.notify_one();
+        hdc = buffers[renderIndex].dc;
+        surface = buffers[renderIndex].surface;
+        ApplyOrientation(hdc);
+    }
+
+    void presenterLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            frameReady.wait(lock, [this] { return readyPending || stopping; });
+            if (stopping) {
+                return;
+            }
+            std::swap(readyIndex, presentIndex);
+            readyPending = false;
+            lock.unlock();
+
+            auto start = std::chrono::steady_clock::now();
+            CopySurface(windowDC, buffers[presentIndex].dc);
+            double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            lock.lock();
+            ++stats.presents;
+            stats.presentMs += elapsedMs;
+        }
+    }
+
+    HWND window = NULL;
+    HDC windowDC = NULL;
+    bool tripleBuffering = false;
+    int frameTimeoutMs = 0;
+    std::vector<Buffer> buffers;
+    int renderIndex = 0;
+    int readyIndex = 0;
+    int presentIndex = 0;
+
+    bool inFrame = false;
+    size_t frameCommands = 0;
+    double frameRenderMs = 0;
+    std::chrono::steady_clock::time_point frameDeadline;
+    std::chrono::steady_clock::time_point lastPresent;
+
+    // Захищає індекси readyIndex/presentIndex, readyPending, stopping і stats
+    std::mutex mutex;
+    std::condition_variable frameReady;
+    std::thread presenter;
+    bool readyPending = false;
+    bool stopping = false;
+    FrameStats stats;
+};
+
+FrameRenderer renderer;
+
 void NetworkThread(SOCKET serverSocket) {
     sockaddr_in clientAddr;
     int clientAddrSize = sizeof(clientAddr);
@@ -661,7 +1606,10 @@ void NetworkThread(SOCKET serverSocket) {
             protocol.parseCommand(buffer, command);
             if (command) {
                 // Відправка повідомлення для основного потоку для малювання
-                PostMessage(hwnd, WM_USER + 1, 0, (LPARAM)command);
+                if (!PostMessage(hwnd, WM_USER + 1, 0, (LPARAM)command)) {
+                    std::cerr << "Error: message queue is full, command dropped" << std::endl;
+                    delete command;
+                }
             }
         }
         catch (const std::invalid_argument& e) {
@@ -671,7 +1619,236 @@ void NetworkThread(SOCKET serverSocket) {
     }
 }
 
-int main() {
+// Потоковий транспорт: кожна команда передається як 4-байтова довжина (big-endian)
+// і далі байти команди у тому ж форматі, що й у UDP-датаграмі.
+const size_t FRAME_HEADER_SIZE = 4;
+const size_t STREAM_BUFFER_SIZE = 1 << 18;
+const int STREAM_PORT = 1111;
+const char* const DEFAULT_UNIX_SOCKET_PATH = "Server3.sock";
+const int STALL_RETRY_MS = 10;
+const size_t NO_POLL_SLOT = static_cast<size_t>(-1);
+
+struct StreamConnection {
+    SOCKET socket;
+    RingBuffer ring;
+    // Черга повідомлень UI-потоку переповнена: кадр лишається в кільці, а сокет
+    // не читається, доки черга не звільниться, тож TCP пригальмовує відправника
+    bool stalled;
+    size_t pollSlot;
+    StreamConnection(SOCKET socket) : socket(socket), ring(STREAM_BUFFER_SIZE), stalled(false), pollSlot(NO_POLL_SLOT) {}
+};
+
+bool DecodeFrames(StreamConnection& connection) {
+    RingBuffer& ring = connection.ring;
+    while (ring.size() >= FRAME_HEADER_SIZE) {
+        RingView header = ring.view(0, FRAME_HEADER_SIZE);
+        uint32_t length = (static_cast<uint32_t>(header[0]) << 24) | (header[1] << 16) | (header[2] << 8) | header[3];
+        if (length == 0 || length > ring.capacity() - FRAME_HEADER_SIZE) {
+            std::cerr << "Invalid frame length: " << length << std::endl;
+            return false;
+        }
+        if (ring.size() < FRAME_HEADER_SIZE + length) {
+            break;
+        }
+
+        Command* command = nullptr;
+        try {
+            protocol.parseCommand(ring.view(FRAME_HEADER_SIZE, length), command);
+            if (command && !PostMessage(hwnd, WM_USER + 1, 0, (LPARAM)command)) {
+                delete command;
+                connection.stalled = true;
+                return true;
+            }
+        }
+        catch (const std::invalid_argument& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+        ring.consume(FRAME_HEADER_SIZE + length);
+    }
+    return true;
+}
+
+// Читає все, що є в сокеті, не блокуючись. Повертає false, якщо з'єднання треба закрити.
+bool ReceiveStream(StreamConnection& connection) {
+    while (connection.ring.writeSpace() != 0) {
+        int recvSize = recv(connection.socket, (char*)connection.ring.writePtr(), (int)connection.ring.writeSpace(), 0);
+        if (recvSize == 0) {
+            return false;
+        }
+        if (recvSize == SOCKET_ERROR) {
+            if (WSAGetLastError() == WSAEWOULDBLOCK) {
+                return true;
+            }
+            std::cerr << "Error receiving stream data" << std::endl;
+            return false;
+        }
+        connection.ring.commit(recvSize);
+        if (!DecodeFrames(connection)) {
+            return false;
+        }
+        if (connection.stalled) {
+            return true;
+        }
+    }
+    return true;
+}
+
+void AcceptConnections(SOCKET listenSocket, std::vector<StreamConnection>& connections) {
+    while (true) {
+        SOCKET clientSocket = accept(listenSocket, NULL, NULL);
+        if (clientSocket == INVALID_SOCKET) {
+            if (WSAGetLastError() != WSAEWOULDBLOCK) {
+                std::cerr << "Error accepting connection" << std::endl;
+            }
+            return;
+        }
+        u_long nonBlocking = 1;
+        ioctlsocket(clientSocket, FIONBIO, &nonBlocking);
+        connections.emplace_back(clientSocket);
+    }
+}
+
+void StreamNetworkThread(std::vector<SOCKET> listenSockets) {
+    std::vector<StreamConnection> connections;
+    std::vector<WSAPOLLFD> pollFds;
+
+    while (true) {
+        // Спершу пробуємо віддати кадри, що чекають на місце в черзі повідомлень.
+        // З кінця, щоб видалення не зсувало індекси ще не оброблених з'єднань
+        bool anyStalled = false;
+        for (size_t i = connections.size(); i-- > 0;) {
+            if (!connections[i].stalled) {
+                continue;
+            }
+            connections[i].stalled = false;
+            if (!DecodeFrames(connections[i])) {
+                closesocket(connections[i].socket);
+                connections.erase(connections.begin() + i);
+            }
+            else if (connections[i].stalled) {
+                anyStalled = true;
+            }
+        }
+
+        pollFds.clear();
+        for (SOCKET listenSocket : listenSockets) {
+            pollFds.push_back({ listenSocket, POLLRDNORM, 0 });
+        }
+        for (StreamConnection& connection : connections) {
+            connection.pollSlot = NO_POLL_SLOT;
+            if (!connection.stalled) {
+                connection.pollSlot = pollFds.size();
+                pollFds.push_back({ connection.socket, POLLRDNORM, 0 });
+            }
+        }
+
+        if (WSAPoll(pollFds.data(), (ULONG)pollFds.size(), anyStalled ? STALL_RETRY_MS : -1) == SOCKET_ERROR) {
+            std::cerr << "Error polling stream sockets" << std::endl;
+            continue;
+        }
+
+        for (size_t i = connections.size(); i-- > 0;) {
+            if (connections[i].pollSlot == NO_POLL_SLOT || pollFds[connections[i].pollSlot].revents == 0) {
+                continue;
+            }
+            if (!ReceiveStream(connections[i])) {
+                closesocket(connections[i].socket);
+                connections.erase(connections.begin() + i);
+            }
+        }
+        for (size_t i = 0; i < listenSockets.size(); ++i) {
+            if (pollFds[i].revents & POLLRDNORM) {
+                AcceptConnections(listenSockets[i], connections);
+            }
+        }
+    }
+}
+
+// Якщо на сокеті вже слухає інший екземпляр, файл видаляти не можна
+bool UnixSocketInUse(const sockaddr_un& addr) {
+    SOCKET probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe == INVALID_SOCKET) {
+        return false;
+    }
+    bool inUse = connect(probe, (const sockaddr*)&addr, sizeof(addr)) == 0;
+    closesocket(probe);
+    return inUse;
+}
+
+SOCKET CreateStreamListener(int family, int ipProtocol, const sockaddr* addr, int addrSize) {
+    SOCKET listenSocket = socket(family, SOCK_STREAM, ipProtocol);
+    if (listenSocket == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+    if (bind(listenSocket, addr, addrSize) == SOCKET_ERROR || listen(listenSocket, SOMAXCONN) == SOCKET_ERROR) {
+        closesocket(listenSocket);
+        return INVALID_SOCKET;
+    }
+    u_long nonBlocking = 1;
+    ioctlsocket(listenSocket, FIONBIO, &nonBlocking);
+    return listenSocket;
+}
+
+int main(int argc, char* argv[]) {
+    // Параметри командного рядка
+    bool tripleBuffering = false;
+    int frameTimeoutMs = 100;
+    PixelFormat pixelFormat = PIXEL_FORMAT_XRGB8888;
+    std::string spriteCachePath;
+    std::string unixSocketPath = DEFAULT_UNIX_SOCKET_PATH;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--triple-buffer") {
+            tripleBuffering = true;
+        }
+        else if (arg == "--frame-timeout" && i + 1 < argc) {
+            int timeoutMs = atoi(argv[++i]);
+            if (timeoutMs > 0) {
+                frameTimeoutMs = timeoutMs;
+            }
+            else {
+                std::cerr << "Invalid frame timeout: " << argv[i] << std::endl;
+            }
+        }
+        else if (arg == "--pixel-format" && i + 1 < argc) {
+            std::string format = argv[++i];
+            if (format == "rgb565") {
+                pixelFormat = PIXEL_FORMAT_RGB565;
+            }
+            else if (format == "rgb888") {
+                pixelFormat = PIXEL_FORMAT_RGB888;
+            }
+            else if (format == "xrgb8888") {
+                pixelFormat = PIXEL_FORMAT_XRGB8888;
+            }
+            else {
+                std::cerr << "Unknown pixel format: " << format << std::endl;
+            }
+        }
+        else if (arg == "--sprite-cache" && i + 1 < argc) {
+            spriteCachePath = argv[++i];
+        }
+        else if (arg == "--unix-socket" && i + 1 < argc) {
+            unixSocketPath = argv[++i];
+        }
+        else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+        }
+    }
+
+    // Відкриття постійного кешу спрайтів
+    if (!spriteCachePath.empty()) {
+        auto start = std::chrono::steady_clock::now();
+        if (spriteCache.open(spriteCachePath)) {
+            double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Sprite cache " << spriteCachePath << " opened with " << spriteCache.count()
+                << " sprites in " << elapsedMs << " ms" << std::endl;
+        }
+        else {
+            std::cerr << "Error opening sprite cache " << spriteCachePath << ", sprites will be kept in memory" << std::endl;
+        }
+    }
+
     // Ініціалізація WinSock
     WSAData wsaData;
     WORD DLLVersion = MAKEWORD(2, 2);
@@ -700,6 +1877,47 @@ int main() {
         return -1;
     }
 
+    // Потокові сокети: TCP на тому ж порту та Unix domain socket для локальних клієнтів
+    std::vector<SOCKET> streamSockets;
+
+    sockaddr_in streamAddr;
+    streamAddr.sin_family = AF_INET;
+    streamAddr.sin_port = htons(STREAM_PORT);
+    streamAddr.sin_addr.s_addr = INADDR_ANY;
+    SOCKET tcpSocket = CreateStreamListener(AF_INET, IPPROTO_TCP, (sockaddr*)&streamAddr, sizeof(streamAddr));
+    if (tcpSocket == INVALID_SOCKET) {
+        std::cerr << "Error creating TCP listener" << std::endl;
+    }
+    else {
+        streamSockets.push_back(tcpSocket);
+    }
+
+    bool unixSocketCreated = false;
+    sockaddr_un unixAddr = { 0 };
+    unixAddr.sun_family = AF_UNIX;
+    // Порожній шлях вимикає Unix domain socket
+    if (unixSocketPath.size() >= sizeof(unixAddr.sun_path)) {
+        std::cerr << "Unix domain socket path is too long: " << unixSocketPath << std::endl;
+    }
+    else if (!unixSocketPath.empty()) {
+        strncpy(unixAddr.sun_path, unixSocketPath.c_str(), sizeof(unixAddr.sun_path) - 1);
+        if (UnixSocketInUse(unixAddr)) {
+            std::cerr << "Unix domain socket " << unixSocketPath << " is in use by another server" << std::endl;
+        }
+        else {
+            // Файл лишився від процесу, що вже завершився
+            DeleteFileA(unixSocketPath.c_str());
+            SOCKET unixSocket = CreateStreamListener(AF_UNIX, 0, (sockaddr*)&unixAddr, sizeof(unixAddr));
+            if (unixSocket == INVALID_SOCKET) {
+                std::cerr << "Error creating Unix domain socket listener" << std::endl;
+            }
+            else {
+                streamSockets.push_back(unixSocket);
+                unixSocketCreated = true;
+            }
+        }
+    }
+
     // Створення вікна
     WNDCLASS wc = { 0 };
     wc.lpfnWndProc = WindowProc;
@@ -710,12 +1928,25 @@ int main() {
     hwnd = CreateWindow(wc.lpszClassName, L"Graphic Display", WS_OVERLAPPEDWINDOW, CW_USEDEFAULT, CW_USEDEFAULT, 800, 600, NULL, NULL, wc.hInstance, NULL);
     ShowWindow(hwnd, SW_SHOW);
     UpdateWindow(hwnd);
-    hdc = GetDC(hwnd);
+    try {
+        renderer.create(hwnd, pixelFormat, tripleBuffering, frameTimeoutMs);
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        closesocket(serverSocket);
+        WSACleanup();
+        return -1;
+    }
 
     // Запуск мережевого потоку
     std::thread networkThread(NetworkThread, serverSocket);
     networkThread.detach();
 
+    if (!streamSockets.empty()) {
+        std::thread streamThread(StreamNetworkThread, streamSockets);
+        streamThread.detach();
+    }
+
     // Основний цикл обробки повідомлень
     MSG msg;
     while (GetMessage(&msg, NULL, 0, 0)) {
@@ -723,13 +1954,23 @@ int main() {
         DispatchMessage(&msg);
         if (msg.message == WM_USER + 1) {
             Command* command = (Command*)msg.lParam;
-            DrawCommand(command);
+            renderer.execute(command);
             delete command;
         }
+        else if (msg.message == WM_TIMER && msg.wParam == FRAME_TIMEOUT_TIMER) {
+            renderer.onTimeout();
+        }
     }
 
-    ReleaseDC(hwnd, hdc);
+    renderer.destroy();
+    spriteCache.close();
     closesocket(serverSocket);
+    for (SOCKET streamSocket : streamSockets) {
+        closesocket(streamSocket);
+    }
+    if (unixSocketCreated) {
+        DeleteFileA(unixSocketPath.c_str());
+    }
     WSACleanup();
     return 0;
 }
\ No newline at end of file